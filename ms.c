@@ -12,6 +12,8 @@
 #include <sys/types.h> /* For time(0) */
 #include <sys/time.h>  /* For time(0) */
 #include <signal.h>
+#include <stdio.h>
+#include <string.h>
 
 #define YES   1
 #define NO    0
@@ -101,10 +103,6 @@ int Y_OFFSET; /* How far from the upper edge the grid begins */
 #define BOMB       '*'
 #define BAD_GUESS  'X'
 #define GOOD_GUESS FLAG /* 251 */
-#define RIPPLE    '@'
-/* It matters only that ripple be distinct from any other value;
- * it is temporary only (used for cascading).
- */
 
 #define CORNER_BORDER     '+' // '%'
 #define HORIZONTAL_BORDER '-' // '%'
@@ -139,6 +137,11 @@ int Y_OFFSET; /* How far from the upper edge the grid begins */
 /* The two things the user can do to a cell: */
 #define FLAG_AT      'f'
 #define STEP_AT      's'
+/* Jump to the next part of the board that still has covered cells: */
+#define NEXT_UNSOLVED 'n'
+#define SAVE_GAME    'w'
+/* Step on everything around a number whose flags are all placed: */
+#define CHORD_AT     'c'
 
 /* The "internal" grid:  where the bombs & neighbor counts
  * actually are (if you could see them):
@@ -150,19 +153,72 @@ unsigned char igrid[MAX_X_SIZE+2][MAX_Y_SIZE+2];
  */
 unsigned char egrid[MAX_X_SIZE+2][MAX_Y_SIZE+2];
 
+/* The where-am-I marker hides what's really in the external grid cell it
+ * sits on.  There's only ever one marker on the grid at a time; this is
+ * where it is & what's under it.  See real_egrid().
+ */
+int marker_x=0, marker_y=0;
+unsigned char cell_contents;
+
+/* A summary of the external grid, a tile at a time.  The grid is carved
+ * into TILE_SIZE x TILE_SIZE tiles, and each tile keeps a count of its
+ * covered cells.  These are kept up to date as cells change (see
+ * set_egrid()), so finding the next region that still needs work means
+ * looking at the tiles rather than at every cell.  (Flags & bombs found
+ * are already counted for the whole grid, in number_of_flags &
+ * bombs_found, which is all the status line & win check need.)
+ */
+#define TILE_SIZE 8
+#define NUM_X_TILES ((MAX_X_SIZE+TILE_SIZE-1)/TILE_SIZE)
+#define NUM_Y_TILES ((MAX_Y_SIZE+TILE_SIZE-1)/TILE_SIZE)
+#define tile_of(i)  (((i)-1)/TILE_SIZE) /* Grid coordinates are 1-up */
+
+int tile_covered[NUM_X_TILES][NUM_Y_TILES];
+#define tile_is_solved(tx, ty) (tile_covered[tx][ty] == 0)
+
 /* Dimensions of the minefield that the user chooses: */
 int xsize=0, ysize=0;
 /* I don't like globals as a rule, but these two variables are
  * used by almost every routine.
  */
 
+/* Where a game in progress is saved to with SAVE_GAME, & whether
+ * we're to pick up where that saved game left off (the -r flag).
+ */
+#define DEFAULT_SAVE_FILE "ms.sav"
+char *save_file = DEFAULT_SAVE_FILE;
+bool resuming = FALSE;
+
+/* With -t, we time how long it takes from a keystroke coming in until
+ * the screen has been updated for it, & print a histogram of those times
+ * for each kind of action when the program exits.
+ */
+bool tracing = FALSE;
+#define LATENCY_MOVE 0
+#define LATENCY_STEP 1
+#define LATENCY_FLAG 2
+#define LATENCY_CHORD 3
+#define NUM_LATENCY_KINDS 4
+
 void sighandler(int signum);
 int  get_grid_size_and_num_bombs();
 void initialize_grids();
+void plant_bomb();
+void rebuild_tile_index();
+void set_egrid();
+int  real_egrid();
+int  next_unsolved();
+int  save_game();
+void resume_game();
+void start_latency();
+void trace_latency();
+void print_latencies();
+void show_status();
 void get_next_move();
 void move_cursor();
 void reveal_all();
 void cascade();
+int  chord();
 void random_pair();
 void display_cell();
 void display_external_grid();
@@ -175,6 +231,8 @@ void sighandler(int signum)
 	echo();
 	mvcur(0, COLS-1, LINES-2, 0);
 	endwin();
+	if (tracing)
+		print_latencies();
 	exit(0);
 }
 
@@ -186,14 +244,19 @@ void usage(prog)
 	echo();
 	mvcur(0, COLS-1, LINES-2, 0);
 	endwin();
-	fprintf(stderr, "Usage:  %s [-s|-m|-l|-w|-f] [-x xsize] [-y ysize] [-n #mines].\n",
+	fprintf(stderr, "Usage:  %s [-s|-m|-l|-w|-f] [-x xsize] [-y ysize] [-n #mines] [-r file] [-t].\n",
 		prog?prog:"");
 	fprintf(stderr, "  -s/m/l are for small, medium or large display; -w is wide;\n");
 	fprintf(stderr, "  -f fills the window.\n");
+	fprintf(stderr, "  -r resumes the game saved in file, & saves there from then on.\n");
+	fprintf(stderr, "  -t prints keystroke-to-screen times when the game is over.\n");
 	fprintf(stderr, "Keystrokes:\n");
 	fprintf(stderr, "* Cursor motion is as in vi: h j k l 0 $ H M L\n");
 	fprintf(stderr, "* Set flags with f\n");
 	fprintf(stderr, "* Step with s\n");
+	fprintf(stderr, "* Chord with c: on a number with all its flags set, step on its other neighbors\n");
+	fprintf(stderr, "* Jump to the next region with covered cells with n\n");
+	fprintf(stderr, "* Save the game with w (to %s unless -r was given)\n", DEFAULT_SAVE_FILE);
 	fprintf(stderr, "* There is no question-mark-setting feature\n");
 	fprintf(stderr, "* Control-C to quit early\n");
 	fprintf(stderr, "* Carriage return to quit at end of game\n");
@@ -210,8 +273,7 @@ int main(argc, argv)
 {
 	bool done=FALSE, won=FALSE;
 	int i, j;
-	int x, y;
-	char action;
+	char action=0;
 	char *term;
 
 	/*if (!get_grid_size_and_num_bombs(&number_of_bombs, argc, argv))*/
@@ -232,33 +294,35 @@ int main(argc, argv)
 			leaveok(stdscr, TRUE); /* Has to do with my "cursor" being visible */
 	signal(SIGINT, sighandler);
 
-	initialize_grids(number_of_bombs);
-	/* Randomly populate the internal grid & cover the external one. */
+	if (resuming)
+		resume_game(save_file, &i, &j);
+		/* Sets the grids, counts & cursor position just as they were. */
+	else {
+		initialize_grids(number_of_bombs);
+		/* Randomly populate the internal grid & cover the external one. */
+		i=xsize/2 + 1;
+		j=ysize/2 + 1;
+	}
 
 	display_external_grid();
-	move_cursor(i=xsize/2 + 1, j=ysize/2 + 1);
+	move_cursor(i, j);
 
 	while (!done) {
-		getyx(stdscr, y, x);
-		move_grid(STATUS_COLUMN_NUMBER, STATUS_LINE_NUMBER);
-		/* Move to screen, not grid, coordinates */
-		clrtoeol();
-		printw("%d/%d", number_of_bombs - number_of_flags, number_of_bombs);
-		move(y, x);
+		show_status();
 		refresh();
 
 		get_next_move(&i, &j, &action);
 
 		if (action == FLAG_AT) {
 			if (egrid[i][j] == FLAG) {
-				egrid[i][j]=COVER;
+				set_egrid(i, j, COVER);
 				number_of_flags--;
 				if (igrid[i][j] == BOMB)
 					bombs_found--;
 				display_cell(i, j, COVER, NO);
 			}
 			else if (egrid[i][j] == COVER) {
-				egrid[i][j]=FLAG;
+				set_egrid(i, j, FLAG);
 				number_of_flags++;
 				if (igrid[i][j]==BOMB)
 					bombs_found++;
@@ -268,19 +332,25 @@ int main(argc, argv)
 		else if (action == STEP_AT) {
 			if (egrid[i][j] == COVER) {
 				if (igrid[i][j] == BOMB) {
-					egrid[i][j]=KABOOM;
+					set_egrid(i, j, KABOOM);
 					done=TRUE;
 					display_cell(i, j, KABOOM, NO);
 					reveal_all();
 				}
 				else if ((igrid[i][j] >= ONE && igrid[i][j] <= EIGHT)
 						|| (igrid[i][j] == BLANK)) {
-					egrid[i][j] = igrid[i][j];
+					set_egrid(i, j, igrid[i][j]);
 					display_cell(i, j, egrid[i][j], NO);
 					cascade(i, j);
 				}
 			}
 		} /* end if (action == STEP_AT) */
+		else if (action == CHORD_AT) {
+			if (chord(i, j)) {
+				done=TRUE;
+				reveal_all();
+			}
+		}
 		else if (action == QUIT) {
 			done=TRUE;
 			display_cell(i, j, 0, NO);
@@ -295,6 +365,17 @@ int main(argc, argv)
 			won=TRUE;
 			done=TRUE;
 		}
+		if (tracing) {
+			/* The status line is part of what the user sees change */
+			show_status();
+			refresh();
+			if (action == STEP_AT)
+				trace_latency(LATENCY_STEP);
+			else if (action == FLAG_AT)
+				trace_latency(LATENCY_FLAG);
+			else if (action == CHORD_AT)
+				trace_latency(LATENCY_CHORD);
+		}
 	} /* end while (!done) */
 	move_grid(STATUS_COLUMN_NUMBER, STATUS_LINE_NUMBER);
 	if (won) {
@@ -316,6 +397,20 @@ int main(argc, argv)
 	/* Just use the clean-up stuff in there to exit, since it's already coded */
 }
 
+/********************************************************************/
+/* Show how many bombs are left to find, leaving the cursor where it was. */
+void show_status()
+{
+	int x, y;
+
+	getyx(stdscr, y, x);
+	move_grid(STATUS_COLUMN_NUMBER, STATUS_LINE_NUMBER);
+	/* Move to screen, not grid, coordinates */
+	clrtoeol();
+	printw("%d/%d", number_of_bombs - number_of_flags, number_of_bombs);
+	move(y, x);
+}
+
 /********************************************************************/
 int get_grid_size_and_num_bombs(_number_of_bombs, argc, argv)
 	int * _number_of_bombs;
@@ -379,6 +474,17 @@ int get_grid_size_and_num_bombs(_number_of_bombs, argc, argv)
 			need_to_calc_bombs=FALSE;
 			argv+=2; argc-=2;
 		}
+		else if (strcmp(argv[0], "-t") == 0) {
+			tracing=TRUE;
+			argv++; argc--;
+		}
+		else if (strcmp(argv[0], "-r") == 0) {
+			if (argc<2)
+				return FALSE;
+			save_file=argv[1];
+			resuming=TRUE;
+			argv+=2; argc-=2;
+		}
 		else
 			return FALSE;
 	}
@@ -419,19 +525,22 @@ void initialize_grids(number_of_bombs)
 	int number_of_bombs;
 {
 	int number_of_tries=0;
-	int bombs_so_far=0, number_of_neighbors;
+	int bombs_so_far=0;
 	int random_x, random_y;
-	int i, j;
-	int i1, i2, i3, j1, j2, j3; /* Used to calculate neighbor counts */
+	int i;
 
 	srand(time(0)^getpid()); /* Seed the pseudo-random generator */
 
-	/* First, initialize the internal grid to be blank. */
+	/* First, initialize the internal grid to be blank.  Only the part
+	 * of each column that's in use (padding included) is touched.
+	 */
 	for (i=0; i<=xsize+1; i++)
-		for (j=0; j<=ysize+1; j++)
-			igrid[i][j] = BLANK;
+		memset(igrid[i], BLANK, ysize+2);
 
-	/* Second, plant the bombs. */
+	/* Second, plant the bombs.  Each new bomb bumps the neighbor counts
+	 * of the cells around it as it goes down, so there's no need for a
+	 * separate pass over the whole grid to make the counts afterward.
+	 */
 	while (bombs_so_far < number_of_bombs) {
 		if (++number_of_tries >= 10*xsize*ysize) {
 			fprintf(stderr, "I'm not doing too well randomly seeding bombs.\n");
@@ -445,42 +554,118 @@ void initialize_grids(number_of_bombs)
 		random_pair(1, xsize, 1, ysize, &random_x, &random_y);
 		if (igrid[random_x][random_y] != BOMB) {
 			bombs_so_far++;
-			igrid[random_x][random_y] = BOMB;
+			plant_bomb(random_x, random_y);
 		}
 
 	}
 
-	/* We set up the grid to be 2 wider than the maximum dimensions + 2.
-	* So, since elements either of whose indices are 0 will have no
-	* bombs, we can use this area for padding when looking for neighbors.
-	*/
+	/* Third, cover the external grid: */
+	for (i=1; i<=xsize; i++)
+		memset(&egrid[i][1], COVER, ysize);
+	rebuild_tile_index();
+}
 
-	/* Third, make the neighbor counts. */
-	for (i=0; i<=xsize; i++) {
-		for (j=0; j<=ysize; j++) {
-			number_of_neighbors = 0;
-			if (igrid[i][j] == BOMB)
-				continue; /* Don't overwrite a bomb. */
-			i1 = i-1; i2 = i; i3 = i+1;
-			j1 = j-1; j2 = j; j3 = j+1;
-			if (igrid[i1][j1] == BOMB) number_of_neighbors++;
-			if (igrid[i1][j2] == BOMB) number_of_neighbors++;
-			if (igrid[i1][j3] == BOMB) number_of_neighbors++;
-			if (igrid[i2][j1] == BOMB) number_of_neighbors++;
-			if (igrid[i2][j3] == BOMB) number_of_neighbors++;
-			if (igrid[i3][j1] == BOMB) number_of_neighbors++;
-			if (igrid[i3][j2] == BOMB) number_of_neighbors++;
-			if (igrid[i3][j3] == BOMB) number_of_neighbors++;
-
-			if (number_of_neighbors > 0)
-				igrid[i][j]=number_of_neighbors+ZERO;
+/* Put a bomb at x,y & add one to the neighbor count of each non-bomb
+ * cell around it.  A cell with no bomb neighbors is a BLANK rather than
+ * a ZERO, so the first bomb next to it makes it a ONE.
+ */
+void plant_bomb(x, y)
+	int x, y;
+{
+	int i, j;
+
+	igrid[x][y] = BOMB;
+	for (i=x-1; i<=x+1; i++) {
+		for (j=y-1; j<=y+1; j++) {
+			if (i < 1 || i > xsize || j < 1 || j > ysize)
+				continue; /* Leave the padding alone */
+			if (igrid[i][j] == BLANK)
+				igrid[i][j] = ONE;
+			else if (igrid[i][j] >= ONE && igrid[i][j] < EIGHT)
+				igrid[i][j]++;
 		}
 	}
+}
 
-	/* Fourth, cover the external grid: */
-	for (j=1; j<=ysize; j++)
-		for (i=1; i<=xsize; i++)
-			egrid[i][j]=COVER;
+/********************************************************************/
+/* Whether a given external-grid value counts as covered for the tile
+ * counts.  The where-am-I marker only ever sits on a cell temporarily, so
+ * it counts as covered.
+ */
+#define counts_as_covered(c) ((c) == COVER || (c) == WHERE_AM_I)
+
+/* Recompute every tile's counts from scratch.  Only needed when the
+ * whole external grid has been (re)written at once; otherwise set_egrid()
+ * keeps the counts current.
+ */
+void rebuild_tile_index()
+{
+	int i, j;
+
+	for (i=0; i<=tile_of(xsize); i++)
+		for (j=0; j<=tile_of(ysize); j++)
+			tile_covered[i][j] = 0;
+
+	for (i=1; i<=xsize; i++)
+		for (j=1; j<=ysize; j++)
+			if (counts_as_covered(egrid[i][j]))
+				tile_covered[tile_of(i)][tile_of(j)]++;
+}
+
+/* All changes to the external grid after initialization go through here,
+ * so that the tile counts stay in step with it.
+ */
+void set_egrid(i, j, c)
+	int i, j;
+	int c;
+{
+	int *covered = &tile_covered[tile_of(i)][tile_of(j)];
+
+	if (counts_as_covered(egrid[i][j]))
+		(*covered)--;
+	egrid[i][j] = c;
+	if (counts_as_covered(egrid[i][j]))
+		(*covered)++;
+}
+
+/* What the external grid really holds at i,j, looking under the
+ * where-am-I marker if it's there.
+ */
+int real_egrid(i, j)
+	int i, j;
+{
+	if (egrid[i][j] == WHERE_AM_I)
+		return cell_contents;
+	return egrid[i][j];
+}
+
+/* Find the next tile, in reading order after the one containing *_i,*_j,
+ * that still has covered cells, & put *_i,*_j on its first covered cell.
+ * The search wraps around, ending with the current tile.  Returns FALSE
+ * (leaving *_i,*_j alone) if every tile is solved.
+ */
+int next_unsolved(_i, _j)
+	int *_i, *_j;
+{
+	int xtiles = tile_of(xsize) + 1, ytiles = tile_of(ysize) + 1;
+	int start = tile_of(*_j) * xtiles + tile_of(*_i);
+	int n, tx, ty;
+	int i, j;
+
+	for (n=1; n<=xtiles*ytiles; n++) {
+		tx = (start + n) % (xtiles*ytiles) % xtiles;
+		ty = (start + n) % (xtiles*ytiles) / xtiles;
+		if (tile_is_solved(tx, ty))
+			continue;
+		for (j=ty*TILE_SIZE+1; j<=ty*TILE_SIZE+TILE_SIZE && j<=ysize; j++)
+			for (i=tx*TILE_SIZE+1; i<=tx*TILE_SIZE+TILE_SIZE && i<=xsize; i++)
+				if (egrid[i][j] == COVER) {
+					*_i = i;
+					*_j = j;
+					return TRUE;
+				}
+	}
+	return FALSE;
 }
 
 /********************************************************************/
@@ -496,7 +681,6 @@ void get_next_move(_i, _j, _action)
 	int oldx, oldy, newx, newy;
 	int key;
 	char action;
-	char cell_contents;
 
 	action = *_action;
 	oldx=*_i; oldy=*_j; newx=*_i; newy=*_j;
@@ -522,16 +706,25 @@ void get_next_move(_i, _j, _action)
 		oldx=newx;
 		oldy=newy;
 		key = getch();
+		if (tracing)
+			start_latency();
 
 		switch(key) {
 			case WHERE_AM_I:
 				if (egrid[oldx][oldy] != WHERE_AM_I) {
+					/* Put back the old marker, if any, first */
+					if (marker_x && egrid[marker_x][marker_y] == WHERE_AM_I) {
+						set_egrid(marker_x, marker_y, cell_contents);
+						display_cell(marker_x, marker_y, cell_contents, NO);
+					}
+					marker_x = oldx;
+					marker_y = oldy;
 					cell_contents = egrid[oldx][oldy];
-					egrid[oldx][oldy] = WHERE_AM_I;
+					set_egrid(oldx, oldy, WHERE_AM_I);
 					display_cell(oldx, oldy, egrid[oldx][oldy], NO);
 				}
 				else {
-					egrid[oldx][oldy] = cell_contents;
+					set_egrid(oldx, oldy, cell_contents);
 					display_cell(oldx, oldy, egrid[oldx][oldy], NO);
 				}
 				break;
@@ -545,6 +738,10 @@ void get_next_move(_i, _j, _action)
 				action=FLAG_AT;
 				got_an_action=TRUE;
 				break;
+			case CHORD_AT:
+				action=CHORD_AT;
+				got_an_action=TRUE;
+				break;
 			case REDRAW:
 				touchwin(stdscr);
 				refresh();
@@ -629,6 +826,17 @@ void get_next_move(_i, _j, _action)
 				newx=xsize/2+1;
 				newy=ysize/2+1;
 				break;
+			case NEXT_UNSOLVED:
+				next_unsolved(&newx, &newy);
+				break;
+			case SAVE_GAME:
+				move_grid(STATUS_COLUMN_NUMBER, STATUS_LINE_NUMBER);
+				clrtoeol();
+				printw("%d/%d  %s %s", number_of_bombs - number_of_flags,
+					number_of_bombs,
+					save_game(save_file, newx, newy) ? "Saved to" : "Couldn't save to",
+					save_file);
+				break;
 		}
 
 		if (newx < 1)     newx = 1; /* Don't let them run off the edge */
@@ -638,6 +846,10 @@ void get_next_move(_i, _j, _action)
 
 		display_cell(oldx, oldy, 0, FALSE);
 		display_cell(newx, newy, 0, TRUE);
+		if (tracing && !got_an_action && (newx != oldx || newy != oldy)) {
+			refresh();
+			trace_latency(LATENCY_MOVE);
+		}
 	}
 	*_i = newx;
 	*_j = newy;
@@ -653,7 +865,6 @@ void move_cursor(x, y) /* Move to grid coordinates */
 	addch(inch()); /* Re-add the character that's already there -- but bold */
 	standend();
 	move_grid(x, y);
-	refresh();
 }
 
 /********************************************************************/
@@ -696,86 +907,474 @@ void reveal_all()
 			addch(c);
 		}
 	}
-	refresh();
 }
 
 /********************************************************************/
 /* The cascade subroutine:  When the user clicks on an empty
  * square, reveal all adjacent empty squares as well, where
  * "adjacent" means directly above, below, right, or left
- * (diagonals do not count).
+ * (diagonals do not count).  Numbers bordering any of those
+ * empty squares, diagonals included, are revealed too.  Flagged
+ * squares are left alone.
+ *
+ * This used to be a recursive flood fill followed by two passes over
+ * the whole grid, with a refresh() per cell; on a big opening that
+ * froze the screen until it was all done.  Now the empty squares still
+ * to be spread from sit on an explicit stack & each square is uncovered
+ * & drawn as soon as it's reached.  Even a whole-board opening takes far
+ * less time than drawing it, so the screen is left for the main loop to
+ * bring up to date in one go.
  */
 
-static void mark_ripples(int cascx, int cascy)
-{
-	if (cascx < 1)     return;
-	if (cascx > xsize) return;
-	if (cascy < 1)     return;
-	if (cascy > ysize) return;
+/* Each square goes on the stack at most once -- it's uncovered as it
+ * goes on -- so a grid's worth of room is always enough.
+ */
+static struct { unsigned char x, y; } ripples[MAX_X_SIZE*MAX_Y_SIZE];
+static int num_ripples=0;
 
-	if ((igrid[cascx][cascy] != BLANK) || (egrid[cascx][cascy] == FLAG))
+/* Uncover x,y if it's still covered.  If it's empty, remember it so
+ * that we can spread from it in turn.  Diagonal neighbors are only
+ * uncovered if they're numbers.
+ */
+static void uncover(int x, int y, bool diagonal)
+{
+	if (x < 1 || x > xsize || y < 1 || y > ysize)
+		return;
+	if (real_egrid(x, y) != COVER) /* Even under the where-am-I marker */
+		return;
+	if (diagonal && !(igrid[x][y] >= ONE && igrid[x][y] <= EIGHT))
 		return;
 
+	set_egrid(x, y, igrid[x][y]);
+	move_grid(x, y);
+	addch(egrid[x][y]);
+	if (igrid[x][y] == BLANK) {
+		ripples[num_ripples].x = x;
+		ripples[num_ripples].y = y;
+		num_ripples++;
+	}
+}
 
-	igrid[cascx][cascy] = RIPPLE;
-	display_cell(cascx,cascy,BLANK, NO);
+/* Spread from every empty square on the stack until there are none left. */
+static void spread_ripples()
+{
+	int x, y;
 
-	mark_ripples(cascx-1, cascy);
-	mark_ripples(cascx+1, cascy);
-	mark_ripples(cascx,   cascy-1);
-	mark_ripples(cascx,   cascy+1);
+	while (num_ripples > 0) {
+		num_ripples--;
+		x = ripples[num_ripples].x;
+		y = ripples[num_ripples].y;
+		uncover(x-1, y,   NO);
+		uncover(x+1, y,   NO);
+		uncover(x,   y-1, NO);
+		uncover(x,   y+1, NO);
+		uncover(x-1, y-1, YES);
+		uncover(x+1, y-1, YES);
+		uncover(x-1, y+1, YES);
+		uncover(x+1, y+1, YES);
+	}
 }
 
-/* Turn ripples back into blanks */
-static void unripple()
+void cascade(cascx, cascy)
+	int cascx, cascy;
+{
+	if (igrid[cascx][cascy] != BLANK)  /* Just for safety's sake */
+		return;
+
+	/* The caller has already uncovered the square stepped on. */
+	ripples[0].x = cascx;
+	ripples[0].y = cascy;
+	num_ripples = 1;
+	spread_ripples();
+
+	/* Position & highlight the cursor */
+	move_cursor(cascx, cascy);
+	display_cell(cascx, cascy, 0, YES);
+}
+
+/* The chord subroutine:  When the user chords on a number that already
+ * has that many flags around it, step on all the other covered squares
+ * around it at once.  Any empty squares among them go on the cascade
+ * stack together, so all the openings they lead to are uncovered in a
+ * single cascade rather than one after another.  If a flag was wrong,
+ * one of those squares is a bomb; returns TRUE if so.
+ */
+int chord(x, y)
+	int x, y;
 {
 	int i, j;
+	int flags=0;
+	int count=real_egrid(x, y);
+	bool kaboom=FALSE;
+
+	/* Look under the where-am-I marker throughout, so that a flag it's
+	 * hiding still counts as a flag & is never stepped on.
+	 */
+	if (!(count >= ONE && count <= EIGHT))
+		return FALSE;
+	for (i=x-1; i<=x+1; i++)
+		for (j=y-1; j<=y+1; j++)
+			if (real_egrid(i, j) == FLAG) /* The padding is never flagged */
+				flags++;
+	if (flags != count - ZERO)
+		return FALSE;
+
+	num_ripples = 0;
+	for (i=x-1; i<=x+1; i++) {
+		for (j=y-1; j<=y+1; j++) {
+			if (i < 1 || i > xsize || j < 1 || j > ysize)
+				continue;
+			if (real_egrid(i, j) != COVER)
+				continue;
+			if (igrid[i][j] == BOMB) {
+				set_egrid(i, j, KABOOM);
+				display_cell(i, j, KABOOM, NO);
+				kaboom=TRUE;
+			}
+			else
+				uncover(i, j, NO);
+		}
+	}
+	spread_ripples();
+	return kaboom;
+}
+
+/********************************************************************/
+/* Saving & resuming a game in progress.
+ *
+ * The grids themselves would make for a big, slow file on a large board,
+ * but there's much less to them than meets the eye: the neighbor counts
+ * follow from where the bombs are, & a revealed cell shows exactly what's
+ * in the internal grid.  So all that's written is a header, then a bit per
+ * cell saying whether there's a bomb there, then two bits per cell saying
+ * whether it's covered, flagged, or revealed.  Cells go in the order they
+ * sit in memory (down each column), eight bits to a byte, low bit first.
+ * Multi-byte numbers in the header are little-endian:
+ *
+ *   "MS01"  xsize ysize (1 byte each)
+ *   number_of_bombs bombs_found number_of_flags (4 bytes each)
+ *   cursor x, y (1 byte each)
+ *   bomb bits, padded to a byte; visibility bits, padded to a byte
+ */
+#define SAVE_MAGIC    "MS01"
+#define SAVE_COVERED  0
+#define SAVE_FLAGGED  1
+#define SAVE_REVEALED 2
+
+static void put_int(fp, n, nbytes)
+	FILE *fp;
+	int n, nbytes;
+{
+	while (nbytes--) {
+		putc(n & 0xff, fp);
+		n >>= 8;
+	}
+}
+
+/* Returns -1 at end of file. */
+static long get_int(fp, nbytes)
+	FILE *fp;
+	int nbytes;
+{
+	unsigned long n=0;
+	int shift=0, c;
+
+	while (nbytes--) {
+		if ((c=getc(fp)) == EOF)
+			return -1;
+		n |= (unsigned long)c << shift;
+		shift += 8;
+	}
+	return n;
+}
+
+/* Returns TRUE if the game was written out in full.  It's written to a
+ * scratch file next to the real one first, & only moved into place once
+ * it's all there, so getting cut off part way through a save doesn't
+ * cost the last good one.
+ */
+int save_game(file, curx, cury)
+	char *file;
+	int curx, cury;
+{
+	FILE *fp;
+	char *scratch;
+	int i, j, c, bits, nbits;
+	int ok;
+
+	if ((scratch=malloc(strlen(file) + sizeof(".tmp"))) == NULL)
+		return FALSE;
+	sprintf(scratch, "%s.tmp", file);
+	if ((fp=fopen(scratch, "wb")) == NULL) {
+		free(scratch);
+		return FALSE;
+	}
 
+	fputs(SAVE_MAGIC, fp);
+	put_int(fp, xsize, 1);
+	put_int(fp, ysize, 1);
+	put_int(fp, number_of_bombs, 4);
+	put_int(fp, bombs_found, 4);
+	put_int(fp, number_of_flags, 4);
+	put_int(fp, curx, 1);
+	put_int(fp, cury, 1);
+
+	bits=0; nbits=0;
 	for (i=1; i<=xsize; i++)
-		for (j=1; j<=ysize; j++)
-			if (igrid[i][j]==RIPPLE)
-				igrid[i][j] = egrid[i][j] = BLANK;
+		for (j=1; j<=ysize; j++) {
+			if (igrid[i][j] == BOMB)
+				bits |= 1 << nbits;
+			if (++nbits == 8) {
+				putc(bits, fp);
+				bits=0; nbits=0;
+			}
+		}
+	if (nbits)
+		putc(bits, fp);
+
+	bits=0; nbits=0;
+	for (i=1; i<=xsize; i++)
+		for (j=1; j<=ysize; j++) {
+			c=real_egrid(i, j); /* A marker isn't saved, but what's under it is */
+			if (c == COVER)
+				c=SAVE_COVERED;
+			else if (c == FLAG)
+				c=SAVE_FLAGGED;
+			else
+				c=SAVE_REVEALED;
+			bits |= c << nbits;
+			if ((nbits+=2) == 8) {
+				putc(bits, fp);
+				bits=0; nbits=0;
+			}
+		}
+	if (nbits)
+		putc(bits, fp);
+
+	ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = FALSE;
+	if (ok && rename(scratch, file) != 0)
+		ok = FALSE;
+	if (!ok)
+		remove(scratch);
+	free(scratch);
+	return ok;
 }
 
-void cascade(cascx, cascy)
+static void cant_resume(file, why)
+	char *file, *why;
 {
-	int i, j;
-	int i1, i2, i3, j1, j2, j3;
+	signal(SIGINT, SIG_IGN);
+	nocrmode();
+	echo();
+	mvcur(0, COLS-1, LINES-2, 0);
+	endwin();
+	fprintf(stderr, "Can't resume from \"%s\": %s.\n", file, why);
+	exit(1);
+}
 
-	if (igrid[cascx][cascy] != BLANK)  /* Just for safety's sake */
-		return;
+/* Sets up the grids & counts from a file written by save_game(), & hands
+ * back where the cursor was.  Doesn't return if it can't.
+ *
+ * The flag counts in the header are only sanity-checked; the real ones
+ * are recounted from the cells, so a damaged count can't throw off the
+ * win check.
+ */
+void resume_game(file, _i, _j)
+	char *file;
+	int *_i, *_j;
+{
+	FILE *fp;
+	char magic[sizeof(SAVE_MAGIC)];
+	long bombs, found, flags, curx, cury;
+	int i, j, c, bits, nbits;
+	int bombs_so_far=0;
+
+	if ((fp=fopen(file, "rb")) == NULL)
+		cant_resume(file, "couldn't open it");
+
+	if (fread(magic, 1, strlen(SAVE_MAGIC), fp) != strlen(SAVE_MAGIC)
+			|| strncmp(magic, SAVE_MAGIC, strlen(SAVE_MAGIC)) != 0)
+		cant_resume(file, "not a saved game");
+	xsize=get_int(fp, 1);
+	ysize=get_int(fp, 1);
+	bombs=get_int(fp, 4);
+	found=get_int(fp, 4);
+	flags=get_int(fp, 4);
+	curx=get_int(fp, 1);
+	cury=get_int(fp, 1);
+	if (xsize < MIN_X_SIZE || ysize < MIN_Y_SIZE
+			|| bombs < 0 || bombs > xsize*ysize
+			|| flags < 0 || flags > xsize*ysize
+			|| found < 0 || found > flags || found > bombs
+			|| curx < 1 || curx > xsize || cury < 1 || cury > ysize)
+		cant_resume(file, "the header is damaged");
+	if (xsize > (COLS-3)/2 || ysize > LINES-3)
+		cant_resume(file, "the board is too big for this window");
+	number_of_bombs=bombs;
+	*_i=curx;
+	*_j=cury;
 
-	//mark_ripples_slow(cascx, cascy);
-	mark_ripples(cascx, cascy);
-	unripple();
+	for (i=0; i<=xsize+1; i++)
+		memset(igrid[i], BLANK, ysize+2);
 
-	/* If a cell with a non-zero neighbor count borders an exposed blank,
-	 * uncover it.
-	 */
-	for (i=1; i<=xsize; i++) {
+	nbits=0;
+	for (i=1; i<=xsize; i++)
 		for (j=1; j<=ysize; j++) {
-			if (igrid[i][j] >= ONE && igrid[i][j] <= EIGHT) {
-				i1 = i-1; i2 = i; i3 = i+1;
-				j1 = j-1; j2 = j; j3 = j+1;
-				if ((egrid[i1][j1] == BLANK) ||
-						(egrid[i1][j2] == BLANK) ||
-						(egrid[i1][j3] == BLANK) ||
-						(egrid[i2][j1] == BLANK) ||
-						(egrid[i2][j3] == BLANK) ||
-						(egrid[i3][j1] == BLANK) ||
-						(egrid[i3][j2] == BLANK) ||
-						(egrid[i3][j3] == BLANK))
-				{
-					egrid[i][j] = igrid[i][j];
-					display_cell(i, j, egrid[i][j], NO);
-				}
+			if (nbits == 0) {
+				if ((bits=getc(fp)) == EOF)
+					cant_resume(file, "it's cut short");
+				nbits=8;
+			}
+			if (bits & 1) {
+				plant_bomb(i, j);
+				bombs_so_far++;
+			}
+			bits >>= 1;
+			nbits--;
+		}
+	if (bombs_so_far != number_of_bombs)
+		cant_resume(file, "the bombs don't add up");
+
+	bombs_found=0;
+	number_of_flags=0;
+
+	nbits=0;
+	for (i=1; i<=xsize; i++)
+		for (j=1; j<=ysize; j++) {
+			if (nbits == 0) {
+				if ((bits=getc(fp)) == EOF)
+					cant_resume(file, "it's cut short");
+				nbits=8;
 			}
+			c=bits & 3;
+			if (c == SAVE_FLAGGED) {
+				egrid[i][j]=FLAG;
+				number_of_flags++;
+				if (igrid[i][j] == BOMB)
+					bombs_found++;
+			}
+			else if (c == SAVE_REVEALED) {
+				if (igrid[i][j] == BOMB)
+					cant_resume(file, "a bomb is showing");
+				egrid[i][j]=igrid[i][j];
+			}
+			else
+				egrid[i][j]=COVER;
+			bits >>= 2;
+			nbits-=2;
 		}
+	fclose(fp);
+	marker_x = marker_y = 0;
+	rebuild_tile_index();
+}
+
+/********************************************************************/
+/* Keystroke-to-screen latency tracing.
+ *
+ * Times are kept in microseconds, in log-linear buckets:  exact below
+ * 16us, & above that eight buckets for each power of two, so any time
+ * lands in a bucket no more than 1/8 wider than its bottom edge.  That
+ * keeps the tails honest without keeping every sample.
+ */
+#define LATENCY_LINEAR_BUCKETS 16
+#define LATENCY_SUB_BUCKETS    8
+#define NUM_LATENCY_BUCKETS    (LATENCY_LINEAR_BUCKETS + 28*LATENCY_SUB_BUCKETS)
+
+static char *latency_names[NUM_LATENCY_KINDS] = { "move", "step", "flag", "chord" };
+static long latency_counts[NUM_LATENCY_KINDS][NUM_LATENCY_BUCKETS];
+static long latency_totals[NUM_LATENCY_KINDS];
+static long latency_max[NUM_LATENCY_KINDS];
+static struct timeval key_time; /* When the last keystroke came in */
+
+static int latency_bucket(usec)
+	long usec;
+{
+	int magnitude=0;
+
+	if (usec < LATENCY_LINEAR_BUCKETS)
+		return usec;
+	while ((usec >> magnitude) >= 2*LATENCY_SUB_BUCKETS)
+		magnitude++;
+	/* Now usec >> magnitude is in [8, 16) */
+	if (magnitude > 28)
+		return NUM_LATENCY_BUCKETS-1;
+	return LATENCY_LINEAR_BUCKETS + (magnitude-1)*LATENCY_SUB_BUCKETS
+		+ (usec >> magnitude) - LATENCY_SUB_BUCKETS;
+}
+
+/* The largest time that goes in a given bucket. */
+static long latency_bucket_top(bucket)
+	int bucket;
+{
+	int magnitude, sub;
+
+	if (bucket < LATENCY_LINEAR_BUCKETS)
+		return bucket;
+	magnitude = (bucket - LATENCY_LINEAR_BUCKETS) / LATENCY_SUB_BUCKETS + 1;
+	sub = (bucket - LATENCY_LINEAR_BUCKETS) % LATENCY_SUB_BUCKETS;
+	return ((long)(LATENCY_SUB_BUCKETS + sub + 1) << magnitude) - 1;
+}
+
+void start_latency()
+{
+	gettimeofday(&key_time, NULL);
+}
+
+/* Called once the screen is up to date after a keystroke. */
+void trace_latency(kind)
+	int kind;
+{
+	struct timeval now;
+	long usec;
+
+	gettimeofday(&now, NULL);
+	usec = (now.tv_sec - key_time.tv_sec) * 1000000L
+		+ (now.tv_usec - key_time.tv_usec);
+	if (usec < 0)
+		usec = 0;
+	latency_counts[kind][latency_bucket(usec)]++;
+	latency_totals[kind]++;
+	if (usec > latency_max[kind])
+		latency_max[kind] = usec;
+}
+
+/* The smallest bucket top that at least fraction of the times are under. */
+static long latency_percentile(kind, fraction)
+	int kind;
+	double fraction;
+{
+	long so_far=0;
+	int b;
+
+	for (b=0; b<NUM_LATENCY_BUCKETS; b++) {
+		so_far += latency_counts[kind][b];
+		if (so_far >= fraction * latency_totals[kind])
+			return latency_bucket_top(b) < latency_max[kind]
+				? latency_bucket_top(b) : latency_max[kind];
 	}
+	return latency_max[kind];
+}
 
-	/* Position & highlight the cursor */
-	move_cursor(cascx, cascy);
-	display_cell(cascx, cascy, 0, YES);
+void print_latencies()
+{
+	int kind, b;
+
+	fprintf(stderr, "Keystroke-to-screen times, in microseconds:\n");
+	for (kind=0; kind<NUM_LATENCY_KINDS; kind++) {
+		if (latency_totals[kind] == 0)
+			continue;
+		fprintf(stderr, "%s: count %ld, p50 %ld, p90 %ld, p99 %ld, p99.9 %ld, max %ld\n",
+			latency_names[kind], latency_totals[kind],
+			latency_percentile(kind, 0.5), latency_percentile(kind, 0.9),
+			latency_percentile(kind, 0.99), latency_percentile(kind, 0.999),
+			latency_max[kind]);
+		for (b=0; b<NUM_LATENCY_BUCKETS; b++)
+			if (latency_counts[kind][b])
+				fprintf(stderr, "  <= %8ld: %ld\n",
+					latency_bucket_top(b), latency_counts[kind][b]);
+	}
 }
 
 /********************************************************************/
@@ -793,6 +1392,15 @@ void random_pair(xlo, xhi, ylo, yhi, outx, outy)
 }
 
 /********************************************************************/
+/* Note that none of the drawing routines -- these, reveal_all(), or the
+ * cascade & chord code -- call refresh() themselves.  They only update
+ * curses' idea of the screen; the main loop refreshes once per move (as
+ * does getch(), implicitly, while the user is moving around), at which
+ * point curses sends just the cells that changed in a single burst of
+ * output.  A refresh() per cell meant a separate write -- & a separate
+ * cursor jump -- for every cell a cascade uncovered.  The only other
+ * refreshes are for the REDRAW key & for -t timing.
+ */
 void display_cell(x, y, c, hilite)
 	int x, y;
 	char c;
@@ -818,8 +1426,6 @@ void display_cell(x, y, c, hilite)
 
 	if (hilite)
 		standend();
-
-	refresh();
 }
 
 /********************************************************************/
@@ -856,6 +1462,4 @@ void display_external_grid()
 			move_grid(i, j);
 			addch(egrid[i][j]);
 		}
-
-	refresh();
 }